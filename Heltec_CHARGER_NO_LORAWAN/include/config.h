@@ -1,8 +1,40 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
-#define WIFI_LORA_32_V3 30  
+#define WIFI_LORA_32_V3 30
 #define SLOW_CLK_TPYE 0  // or 1 if using external 32K slow clock
 #define HELTEC_BOARD WIFI_LORA_32_V3
 
+// Wake interval while the battery is charging, in seconds
+#define CHARGE_WAKE_INTERVAL 900     // 15 minutes
+// Wake interval once the battery is considered full, in seconds
+#define FULL_WAKE_INTERVAL 21600     // 6 hours
+
+/*
+ * Charge-completion heuristic. The charger holds the cell at about 4.2 V in its
+ * constant-voltage (CV) phase while current is still flowing, so a flat voltage
+ * alone does not mean the charge is complete. The CV phase starts once a
+ * sample reaches CHARGE_CV_MV and lasts until the voltage falls below
+ * CHARGE_RESUME_MV, so a relaxing cell that drops below CHARGE_CV_MV is still
+ * tracked. The battery counts as full when
+ * - the voltage stays CHARGE_RELAX_MV below the CV peak for CHARGE_RELAX_WAKES
+ *   consecutive wakes, which happens once the charger terminates and the cell
+ *   rests; a single noisy reading is not enough, or
+ * - the CV phase has lasted CHARGE_CV_MAX_WAKES wakes, longer than the
+ *   expected current taper, for chargers that keep topping up.
+ * Limits: the divider measures the charger output, not the cell. A fast
+ * top-up cycle can hide the relaxation, and then only the timeout applies.
+ * Unplugging the charger drops the voltage below CHARGE_RESUME_MV and is not
+ * taken as completion.
+ */
+#define CHARGE_CV_MV 4150
+#define CHARGE_RELAX_MV 30
+#define CHARGE_RELAX_WAKES 3         // 45 minutes at CHARGE_WAKE_INTERVAL
+#define CHARGE_CV_MAX_WAKES 12       // 3 hours at CHARGE_WAKE_INTERVAL
+// Battery is considered charging again once it drops below this voltage
+#define CHARGE_RESUME_MV 4050
+
+// Number of (wake, voltage) entries kept in RTC memory, oldest entries are overwritten
+#define CHARGE_LOG_SIZE 256
+
 #endif // CONFIG_H
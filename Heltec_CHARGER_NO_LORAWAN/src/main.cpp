@@ -1,37 +1,147 @@
 /*
  * Minimal Firmware for Heltec LoRa 3.2
- * Purpose: Battery Charging Only - No functionality
- * 
- * This firmware does nothing except allow the board to charge batteries.
- * Deep sleep mode is enabled to minimize power consumption.
+ * Purpose: Battery Charging - charge monitoring only
+ *
+ * The board spends almost all of its time in deep sleep. On every timer wake
+ * it samples the battery voltage through the ADC_CTRL divider, appends it to
+ * a charge curve kept in RTC memory and goes back to sleep within a few ms.
+ * Once the battery looks full the wake interval is stretched.
+ *
+ * Press the PRG button while a host is attached to dump the charge curve
+ * as CSV on the serial port (115200 baud).
   */
 
 #include <Arduino.h>
 #include <esp_sleep.h>
+#include <driver/rtc_io.h>
 
-// Deep sleep duration in seconds (wake up every hour to check status)
-#define DEEP_SLEEP_DURATION 3600  // 1 hour in seconds
+#include "config.h"
 
-void setup() {
-  // Minimal initialization
+#define Read_VBAT_Voltage 1
+#define ADC_CTRL 37 // Heltec GPIO to toggle VBatt read connection
+#define ADC_SETTLE_MS 2 // in ms, divider settle time after enabling ADC_CTRL
+#define ADC_SAMPLES 16 // number of ADC reads averaged per wake, keeps the noise well below CHARGE_RELAX_MV
+#define PRG_BUTTON GPIO_NUM_0 // PRG button, active low
+
+struct ChargeSample {
+  uint32_t wake;
+  uint16_t millivolts;
+};
+
+// Kept across deep sleep, reset on power-on
+RTC_DATA_ATTR static uint32_t wakeCount = 0;
+RTC_DATA_ATTR static uint16_t logHead = 0;   // next slot to write
+RTC_DATA_ATTR static uint16_t logCount = 0;  // number of valid entries
+RTC_DATA_ATTR static bool batteryFull = false;
+RTC_DATA_ATTR static uint16_t cvWakes = 0;   // wakes spent in the CV phase, 0 = not reached
+RTC_DATA_ATTR static uint16_t cvPeakMv = 0;  // highest voltage seen in the CV phase
+RTC_DATA_ATTR static uint16_t relaxedWakes = 0;  // consecutive wakes at least CHARGE_RELAX_MV below the peak
+RTC_DATA_ATTR static ChargeSample chargeLog[CHARGE_LOG_SIZE];
+
+/* Reads the battery voltage in mV, ADC divider only enabled while sampling */
+static uint16_t readBatteryMilliVolts() {
+  pinMode(ADC_CTRL, OUTPUT);
+  digitalWrite(ADC_CTRL, HIGH);
+  delay(ADC_SETTLE_MS);
+  uint32_t sum = 0;
+  for (int i = 0; i < ADC_SAMPLES; i++) {
+    sum += analogReadMilliVolts(Read_VBAT_Voltage);
+  }
+  digitalWrite(ADC_CTRL, LOW);
+  // Convert to actual battery voltage (divider factor 4.9)
+  return (uint16_t)(sum * 49 / (ADC_SAMPLES * 10));
+}
+
+/* Returns the n-th most recent sample (0 = newest) */
+static const ChargeSample &recentSample(uint16_t n) {
+  return chargeLog[(logHead + CHARGE_LOG_SIZE - 1 - n) % CHARGE_LOG_SIZE];
+}
+
+static void logSample(uint16_t millivolts) {
+  chargeLog[logHead].wake = wakeCount;
+  chargeLog[logHead].millivolts = millivolts;
+  logHead = (logHead + 1) % CHARGE_LOG_SIZE;
+  if (logCount < CHARGE_LOG_SIZE) logCount++;
+}
+
+static void resetCvState() {
+  cvWakes = 0;
+  cvPeakMv = 0;
+  relaxedWakes = 0;
+}
+
+/* See the charge-completion heuristic in config.h */
+static bool looksFull(uint16_t millivolts) {
+  // Unplugged or discharging, not a completed charge
+  if (millivolts < CHARGE_RESUME_MV) {
+    resetCvState();
+    return false;
+  }
+  // The CV phase is kept once reached, the relaxed cell may drop below CHARGE_CV_MV
+  if (cvWakes == 0 && millivolts < CHARGE_CV_MV) {
+    return false;
+  }
+  cvWakes++;
+  cvPeakMv = max(cvPeakMv, millivolts);
+  // Charger terminated: the cell stays relaxed below the CV peak
+  if (cvPeakMv - millivolts >= CHARGE_RELAX_MV) {
+    relaxedWakes++;
+  } else {
+    relaxedWakes = 0;
+  }
+  return relaxedWakes >= CHARGE_RELAX_WAKES || cvWakes >= CHARGE_CV_MAX_WAKES;
+}
+
+static void updateChargeState(uint16_t millivolts) {
+  if (!batteryFull) {
+    batteryFull = looksFull(millivolts);
+  } else if (millivolts < CHARGE_RESUME_MV) {
+    batteryFull = false;
+    resetCvState();
+  }
+}
+
+/* Prints the charge curve as CSV, oldest entry first */
+static void printChargeLog() {
   Serial.begin(115200);
-  delay(100);  // Give serial time to initialize
-  
   Serial.println("Heltec LoRa 3.2 - Battery Charging Mode");
-  Serial.println("Entering deep sleep to minimize power consumption");
-  Serial.printf("Will wake up every %d seconds\n", DEEP_SLEEP_DURATION);
-  
-  delay(1000);  // Give time to see the message
-  
-  // Configure deep sleep timer wake-up
-  esp_sleep_enable_timer_wakeup(DEEP_SLEEP_DURATION * 1000000ULL);  // Convert to microseconds
-  
-  // Enter deep sleep
-  Serial.println("Going to sleep now...");
-  Serial.flush();  // Ensure message is sent before sleeping
+  Serial.printf("state=%s wakes=%lu interval=%d s\n",
+                batteryFull ? "full" : "charging", (unsigned long)wakeCount,
+                batteryFull ? FULL_WAKE_INTERVAL : CHARGE_WAKE_INTERVAL);
+  Serial.println("wake,millivolts");
+  for (int i = logCount - 1; i >= 0; i--) {
+    const ChargeSample &s = recentSample(i);
+    Serial.printf("%lu,%u\n", (unsigned long)s.wake, s.millivolts);
+  }
+  Serial.flush();  // Ensure everything is sent before sleeping
+}
+
+void setup() {
+  esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+
+  uint16_t millivolts = readBatteryMilliVolts();
+  wakeCount++;
+  logSample(millivolts);
+  updateChargeState(millivolts);
+
+  // Serial is only brought up when someone asked for the log
+  if (cause == ESP_SLEEP_WAKEUP_EXT0) {
+    printChargeLog();
+    // Wait for the button to be released, otherwise ext0 wakes us right away
+    pinMode(PRG_BUTTON, INPUT_PULLUP);
+    while (digitalRead(PRG_BUTTON) == LOW) delay(10);
+  }
+
+  uint32_t interval = batteryFull ? FULL_WAKE_INTERVAL : CHARGE_WAKE_INTERVAL;
+  esp_sleep_enable_timer_wakeup(interval * 1000000ULL);  // Convert to microseconds
+
+  // PRG button wakes the board to dump the log
+  rtc_gpio_pullup_en(PRG_BUTTON);
+  esp_sleep_enable_ext0_wakeup(PRG_BUTTON, 0);
+
   esp_deep_sleep_start();
 }
 
 void loop() {
   // This will never be reached because of deep sleep
-}
\ No newline at end of file
+}
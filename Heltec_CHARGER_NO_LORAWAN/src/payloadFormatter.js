@@ -3,6 +3,7 @@ function decodeUplink(input) {
 
   var version = bytes[0]; // First byte is version
   var temperature = (bytes[1] << 8) | bytes[2]; // Combine MSB and LSB for temperature
+  if (temperature & 0x8000) temperature -= 0x10000; // Signed int16, below 0 °C
   var humidity = (bytes[3] << 8) | bytes[4];    // Combine MSB and LSB for humidity
   var pressure = (bytes[5] << 16) | (bytes[6] << 8) | bytes[7]; // Combine MSB, middle byte, and LSB for pressure
   var voltage = (bytes[8] << 8) | bytes[9]; // Combine MSB and LSB for voltage
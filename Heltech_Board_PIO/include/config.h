@@ -5,4 +5,23 @@
 #define SLOW_CLK_TPYE 0  // or 1 if using external 32K slow clock
 #define HELTEC_BOARD WIFI_LORA_32_V3
 
+// Sensor acquisition interval in milliseconds (default: 10 seconds)
+#define SAMPLE_INTERVAL_MS 10000
+
+// Join DR, and uplink DR while ADR is off
+#define LORAWAN_DEFAULT_DR 3
+// Random offset of +/- this many milliseconds added to every uplink interval
+#define UPLINK_JITTER_MS 1000
+
+// Core and priority of the FreeRTOS tasks, the radio stays in the Arduino loop on ARDUINO_RUNNING_CORE (1)
+#define ACQUISITION_TASK_CORE 0
+#define ACQUISITION_TASK_PRIO 3
+#define SERIAL_TASK_CORE 0
+#define SERIAL_TASK_PRIO 1
+#define DISPLAY_TASK_CORE 0
+#define DISPLAY_TASK_PRIO 1
+
+// OLED status screen: switched on by the PRG button, off again after this time in milliseconds
+#define STATUS_DISPLAY_ON_MS 30000
+
 #endif // CONFIG_H
@@ -0,0 +1,255 @@
+#include "airtime.h"
+
+/* No Arduino dependencies here, the host-side simulator links this file too */
+
+uint32_t lora_airtime_us(uint8_t sf, uint32_t bw_hz, uint16_t phy_len,
+                         uint8_t cr, uint16_t preamble, bool crc, bool implicit_header)
+{
+    // Low data rate optimization is mandatory for symbols longer than 16 ms
+    uint32_t tsym_us = (uint32_t)((1000000ULL << sf) / bw_hz);
+    int de = tsym_us > 16000 ? 1 : 0;
+
+    int32_t num = 8 * phy_len - 4 * sf + 28 + (crc ? 16 : 0) - (implicit_header ? 20 : 0);
+    int32_t den = 4 * (sf - 2 * de);
+    int32_t payload_symb = 8;
+    if (num > 0)
+        payload_symb += ((num + den - 1) / den) * (cr + 4);
+
+    // Preamble is (preamble + 4.25) symbols, kept in quarter symbols to stay integer
+    return ((4 * preamble + 17) * tsym_us) / 4 + payload_symb * tsym_us;
+}
+
+bool eu868_dr_params(uint8_t dr, uint8_t *sf, uint32_t *bw_hz)
+{
+    if (dr <= 5)
+    {
+        *sf = 12 - dr;
+        *bw_hz = 125000;
+        return true;
+    }
+    if (dr == 6)
+    {
+        *sf = 7;
+        *bw_hz = 250000;
+        return true;
+    }
+    return false;
+}
+
+uint32_t eu868_uplink_airtime_us(uint8_t dr, uint16_t app_len)
+{
+    uint8_t sf;
+    uint32_t bw_hz;
+    if (!eu868_dr_params(dr, &sf, &bw_hz))
+        return 0;
+    // Uplinks use explicit header, CRC on, coding rate 4/5 and 8 preamble symbols
+    return lora_airtime_us(sf, bw_hz, app_len + LORAWAN_FRAME_OVERHEAD, 1, 8, true, false);
+}
+
+uint8_t confirmed_trial_dr(uint8_t dr, uint8_t trial)
+{
+    uint8_t step = trial / 2;
+    return dr > step ? dr - step : 0;
+}
+
+uint32_t eu868_confirmed_airtime_us(uint8_t dr, uint16_t app_len, uint8_t nb_trials)
+{
+    uint32_t total = 0;
+    for (uint8_t i = 0; i < nb_trials; i++)
+        total += eu868_uplink_airtime_us(confirmed_trial_dr(dr, i), app_len);
+    return total;
+}
+
+uint32_t confirmed_trial_start_ms(uint8_t dr, uint16_t app_len, uint8_t trial, uint32_t gap_ms)
+{
+    uint32_t start = 0;
+    for (uint8_t i = 0; i < trial; i++)
+        start += (eu868_uplink_airtime_us(confirmed_trial_dr(dr, i), app_len) + 999) / 1000 + gap_ms;
+    return start;
+}
+
+/* Channels per band with the default userChannelsMask 0x00FF */
+static const uint8_t band_channels[EU868_BAND_COUNT] = {3, 5};
+#define ENABLED_CHANNELS 8
+// Longest off-time a band can have, older off_until_ms values are treated as expired after the clock wraps
+#define BAND_OFF_MAX_MS 3600000L
+
+static void bucket_init(airtime_bucket_t *b, int32_t cap_us, uint32_t refill_us, uint32_t refill_ms, uint32_t now_ms)
+{
+    b->credit_us = cap_us;
+    b->cap_us = cap_us;
+    b->refill_us = refill_us;
+    b->refill_ms = refill_ms;
+    b->last_ms = now_ms;
+}
+
+/* Refills in whole steps so no credit is lost to rounding however often this is called */
+static void bucket_refill(airtime_bucket_t *b, uint32_t now_ms)
+{
+    uint32_t steps = (now_ms - b->last_ms) / b->refill_ms;
+    int64_t credit = b->credit_us + (int64_t)steps * b->refill_us;
+    b->last_ms += steps * b->refill_ms;
+    if (credit >= b->cap_us)
+    {
+        credit = b->cap_us;
+        b->last_ms = now_ms;
+    }
+    b->credit_us = (int32_t)credit;
+}
+
+static uint32_t bucket_wait_ms(const airtime_bucket_t *b, uint32_t airtime_us)
+{
+    int64_t missing = (int64_t)airtime_us - b->credit_us;
+    if (missing <= 0)
+        return 0;
+    uint64_t steps = (missing + b->refill_us - 1) / b->refill_us;
+    return (uint32_t)(steps * b->refill_ms);
+}
+
+static uint32_t band_off_ms(const airtime_budget_t *budget, uint8_t band, uint32_t now_ms)
+{
+    int32_t left = (int32_t)(budget->off_until_ms[band] - now_ms);
+    return left > 0 && left <= BAND_OFF_MAX_MS ? (uint32_t)left : 0;
+}
+
+static uint32_t band_share_us(uint8_t band, uint32_t airtime_us)
+{
+    return (uint32_t)(((uint64_t)airtime_us * band_channels[band] + ENABLED_CHANNELS - 1) / ENABLED_CHANNELS);
+}
+
+uint32_t airtime_sustainable_interval_ms(uint32_t airtime_us)
+{
+    // Day budget: airtime_us every airtime_us * 86400 s / 30 s
+    uint64_t day = (uint64_t)airtime_us * 86400000ULL / TTN_DAY_BUDGET_US;
+    // Band budget: the busier band gets its share every share * 100
+    uint64_t band = 0;
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        uint64_t b = (uint64_t)band_share_us(i, airtime_us) * 100 / 1000;
+        if (b > band)
+            band = b;
+    }
+    return (uint32_t)(day > band ? day : band);
+}
+
+void airtime_budget_init(airtime_budget_t *budget, uint32_t now_ms)
+{
+    // 1% duty cycle: 10 µs of airtime per ms
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+        bucket_init(&budget->band[i], EU868_BAND_BUDGET_US, 10, 1, now_ms);
+    // 30 s per 86400 s: 25 µs of airtime per 72 ms
+    bucket_init(&budget->day, TTN_DAY_BUDGET_US, 25, 72, now_ms);
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+        budget->off_until_ms[i] = now_ms;
+}
+
+static bool bucket_restore(airtime_bucket_t *b, const airtime_bucket_t *ref, uint32_t now_ms)
+{
+    if (b->cap_us != ref->cap_us || b->refill_us != ref->refill_us || b->refill_ms != ref->refill_ms ||
+        b->credit_us > b->cap_us || b->credit_us < -b->cap_us)
+        return false;
+    if ((int32_t)(now_ms - b->last_ms) < 0)
+        b->last_ms = now_ms;
+    return true;
+}
+
+bool airtime_budget_restore(airtime_budget_t *budget, uint32_t now_ms)
+{
+    airtime_budget_t ref;
+    airtime_budget_init(&ref, now_ms);
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        if (!bucket_restore(&budget->band[i], &ref.band[i], now_ms))
+            return false;
+    }
+    if (!bucket_restore(&budget->day, &ref.day, now_ms))
+        return false;
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        if ((int32_t)(budget->off_until_ms[i] - now_ms) > BAND_OFF_MAX_MS)
+            budget->off_until_ms[i] = now_ms;
+    }
+    return true;
+}
+
+void airtime_budget_charge(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        bucket_refill(&budget->band[i], now_ms);
+        budget->band[i].credit_us -= band_share_us(i, airtime_us);
+    }
+    bucket_refill(&budget->day, now_ms);
+    budget->day.credit_us -= airtime_us;
+}
+
+void airtime_budget_charge_band(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t now_ms)
+{
+    bucket_refill(&budget->band[band], now_ms);
+    budget->band[band].credit_us -= airtime_us;
+    bucket_refill(&budget->day, now_ms);
+    budget->day.credit_us -= airtime_us;
+}
+
+void airtime_budget_transmit(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t at_ms)
+{
+    if (band == EU868_BAND_ANY)
+    {
+        band = 0;
+        for (uint8_t i = 1; i < EU868_BAND_COUNT; i++)
+            if (band_off_ms(budget, i, at_ms) < band_off_ms(budget, band, at_ms))
+                band = i;
+    }
+    // A blocked band delays the transmission until its off-time is over
+    uint32_t start = at_ms + band_off_ms(budget, band, at_ms);
+    uint32_t off = (uint32_t)(((uint64_t)airtime_us * (EU868_BAND_OFF_FACTOR + 1) + 999) / 1000);
+    budget->off_until_ms[band] = start + off;
+}
+
+void airtime_budget_refund(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms)
+{
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        budget->band[i].credit_us += band_share_us(i, airtime_us);
+        bucket_refill(&budget->band[i], now_ms);
+    }
+    budget->day.credit_us += airtime_us;
+    bucket_refill(&budget->day, now_ms);
+}
+
+uint32_t airtime_budget_wait_ms(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms)
+{
+    uint32_t wait = 0, w;
+    for (uint8_t i = 0; i < EU868_BAND_COUNT; i++)
+    {
+        bucket_refill(&budget->band[i], now_ms);
+        w = bucket_wait_ms(&budget->band[i], band_share_us(i, airtime_us));
+        if (w > wait)
+            wait = w;
+    }
+    bucket_refill(&budget->day, now_ms);
+    w = bucket_wait_ms(&budget->day, airtime_us);
+    if (w > wait)
+        wait = w;
+    // The MAC holds the frame until one of the bands is free
+    uint32_t off = band_off_ms(budget, 0, now_ms);
+    for (uint8_t i = 1; i < EU868_BAND_COUNT; i++)
+    {
+        w = band_off_ms(budget, i, now_ms);
+        if (w < off)
+            off = w;
+    }
+    return off > wait ? off : wait;
+}
+
+uint32_t airtime_budget_wait_band_ms(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t now_ms)
+{
+    bucket_refill(&budget->band[band], now_ms);
+    uint32_t wait = bucket_wait_ms(&budget->band[band], airtime_us);
+    bucket_refill(&budget->day, now_ms);
+    uint32_t w = bucket_wait_ms(&budget->day, airtime_us);
+    if (w > wait)
+        wait = w;
+    w = band_off_ms(budget, band, now_ms);
+    return w > wait ? w : wait;
+}
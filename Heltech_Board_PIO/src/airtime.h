@@ -0,0 +1,109 @@
+#ifndef __AIRTIME_H__
+#define __AIRTIME_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// LoRaWAN PHY overhead of a data frame without FOpts: MHDR(1) + FHDR(7) + FPort(1) + MIC(4)
+#define LORAWAN_FRAME_OVERHEAD 13
+// PHY length of a join request: MHDR(1) + AppEUI(8) + DevEUI(8) + DevNonce(2) + MIC(4)
+#define LORAWAN_JOIN_REQUEST_SIZE 23
+
+// EU868 sub-bands used for uplinks, both limited to 1% duty cycle
+#define EU868_BAND_868_0 0 // 868.0 - 868.6 MHz, default channels 0-2
+#define EU868_BAND_865_0 1 // 865.0 - 868.0 MHz, channels 3-7 (867.1 - 867.9 MHz on TTN)
+#define EU868_BAND_COUNT 2
+// Any band, the MAC picks a channel on a band that is not blocked
+#define EU868_BAND_ANY 0xFF
+// LoRaMac blocks a 1% band for 99 times the time on air after each transmission
+#define EU868_BAND_OFF_FACTOR 99
+
+// Confirmed retries start RECEIVE_DELAY2 (2 s) + ACK_TIMEOUT (2 +/- 1 s) after the end of the previous transmission
+#define CONFIRMED_RETRY_GAP_MIN_MS 3000
+#define CONFIRMED_RETRY_GAP_MAX_MS 5000
+
+// Rolling budgets: 1% per band over one hour, TTN fair use 30 s per day
+#define EU868_BAND_BUDGET_US 36000000L
+#define TTN_DAY_BUDGET_US 30000000L
+
+    /* Credit bucket refilled with refill_us every refill_ms, capped at cap_us */
+    typedef struct
+    {
+        int32_t credit_us;
+        int32_t cap_us;
+        uint32_t refill_us;
+        uint32_t refill_ms;
+        uint32_t last_ms;
+    } airtime_bucket_t;
+
+    /* Airtime accounting for one device, plain data so it can live in memory that survives resets */
+    typedef struct
+    {
+        airtime_bucket_t band[EU868_BAND_COUNT];
+        airtime_bucket_t day;
+        uint32_t off_until_ms[EU868_BAND_COUNT]; // end of the MAC's off-time per band
+    } airtime_budget_t;
+
+    /* Time on air in µs of a LoRa packet, cr is 1..4 for 4/5..4/8 (Semtech AN1200.13) */
+    uint32_t lora_airtime_us(uint8_t sf, uint32_t bw_hz, uint16_t phy_len,
+                             uint8_t cr, uint16_t preamble, bool crc, bool implicit_header);
+
+    /* EU868 data rate to spreading factor / bandwidth, returns false for FSK or unknown DRs */
+    bool eu868_dr_params(uint8_t dr, uint8_t *sf, uint32_t *bw_hz);
+
+    /* Time on air in µs of a LoRaWAN EU868 uplink with app_len application bytes, 0 for invalid DRs */
+    uint32_t eu868_uplink_airtime_us(uint8_t dr, uint16_t app_len);
+
+    /* Data rate of transmission number trial (0 = first) of a confirmed frame, LoRaWAN 1.0.2 ch. 18.4 */
+    uint8_t confirmed_trial_dr(uint8_t dr, uint8_t trial);
+
+    /* Worst case time on air in µs of a confirmed uplink that needs all nb_trials transmissions */
+    uint32_t eu868_confirmed_airtime_us(uint8_t dr, uint16_t app_len, uint8_t nb_trials);
+
+    /* Start in ms of transmission number trial (0 = first) of a confirmed uplink, relative to the first */
+    uint32_t confirmed_trial_start_ms(uint8_t dr, uint16_t app_len, uint8_t trial, uint32_t gap_ms);
+
+    /* Shortest uplink interval in ms at which frames of airtime_us can be sent indefinitely */
+    uint32_t airtime_sustainable_interval_ms(uint32_t airtime_us);
+
+    /* Starts with full budgets at now_ms */
+    void airtime_budget_init(airtime_budget_t *budget, uint32_t now_ms);
+
+    /*
+     * Checks a budget kept in memory that survives resets. Returns false if it does not hold a
+     * budget (power-on), otherwise timestamps from before a clock reset are moved to now_ms,
+     * which only delays refills.
+     */
+    bool airtime_budget_restore(airtime_budget_t *budget, uint32_t now_ms);
+
+    /* Books a transmission, airtime is split over the bands by their share of enabled channels */
+    void airtime_budget_charge(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms);
+
+    /* Books a transmission on one band only, e.g. join requests which use the default channels 0-2 */
+    void airtime_budget_charge_band(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t now_ms);
+
+    /*
+     * Records a transmission starting at at_ms for the MAC's band off-time. With EU868_BAND_ANY
+     * the band that is free first is taken, like the MAC which only picks channels on free bands.
+     */
+    void airtime_budget_transmit(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t at_ms);
+
+    /* Returns airtime booked for transmissions that did not happen */
+    void airtime_budget_refund(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms);
+
+    /* Milliseconds until airtime_us can be sent without exceeding any budget and a band is free, 0 if right away */
+    uint32_t airtime_budget_wait_ms(airtime_budget_t *budget, uint32_t airtime_us, uint32_t now_ms);
+
+    /* Like airtime_budget_wait_ms() for a transmission booked with airtime_budget_charge_band() */
+    uint32_t airtime_budget_wait_band_ms(airtime_budget_t *budget, uint8_t band, uint32_t airtime_us, uint32_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__AIRTIME_H__
@@ -5,18 +5,44 @@
 #include <SPI.h>
 #include <Wire.h>
 #include <EEPROM.h>
+#include <sys/time.h>
+#include <atomic>
 
+#include "airtime.h"
 #include "led.h"
+#include "oled.h"
+#include "payload.h"
+#include "sample_accumulator.h"
 
 #define Read_VBAT_Voltage 1
 #define ADC_CTRL 37 // Heltec GPIO to toggle VBatt read connection …
 #define ADC_READ_STABILIZE 10 // in ms (delay from GPIO control and ADC connections times)
+#define PRG_BUTTON 0 // PRG button, active low, switches the status display on
+#define DISPLAY_POLL_MS 100 // button poll and display redraw interval
+
+// Downlink commands, first byte of the downlink payload
+#define DOWNLINK_CMD_SEND_NOW 0x01 // measure and send immediately
+#define DOWNLINK_CMD_SET_DUTY 0x02 // followed by the uplink interval in minutes (uint16, MSB first)
+
+// Delay before retrying a failed join, same as the stack's own rejoin delay
+#define JOIN_RETRY_MS 30000
+// A join accept arrives in RX2 at the latest, JOIN_ACCEPT_DELAY2 (6 s) after the request
+#define JOIN_ACCEPT_TIMEOUT_MS 8000
 
 Adafruit_BME280 bme;  // use I2C interface
 Adafruit_Sensor *bme_temp = bme.getTemperatureSensor();
 Adafruit_Sensor *bme_pressure = bme.getPressureSensor();
 Adafruit_Sensor *bme_humidity = bme.getHumiditySensor();
 
+// Filled by acquisitionTask (core 0), read by the radio in loop() (core 1) and the status display
+static SampleAccumulator sampleTotals;
+
+static TaskHandle_t acquisitionTaskHandle = NULL;
+// Set by the acquisition task once an on-demand sample is queued, consumed by loop()
+static std::atomic<bool> sendNowPending{false};
+// Next frame carries only the latest sample instead of the average
+static bool sendLatestOnly = false;
+
 // devEUI will be auto generated, -D LORAWAN_DEVEUI_AUTO should be set
 uint8_t devEui[8];
 // appEui seems to be optional, set to all zeros
@@ -37,7 +63,12 @@ LoRaMacRegion_t loraWanRegion = LORAMAC_REGION_EU868;
 // LoRaMacRegion_t loraWanRegion = ACTIVE_REGION;
 
 /*LoraWan Class, Class A and Class C are supported*/
+#ifdef LORAWAN_CLASS_C
+// Mains-powered nodes: receive window always open, downlinks arrive within seconds
+DeviceClass_t loraWanClass = CLASS_C;
+#else
 DeviceClass_t loraWanClass = CLASS_A;
+#endif
 
 /*the application data transmission duty cycle.  value in [ms].*/
 uint32_t appTxDutyCycle = 600000; // DEFAULT 10 minutes
@@ -77,6 +108,78 @@ uint8_t appPort = 2;
 */
 uint8_t confirmedNbTrials = 4;
 
+// EU868 duty-cycle and TTN fair-use accounting. RTC_NOINIT memory is kept across crashes, watchdog
+// and brownout resets, so a reboot loop cannot start over with a full budget; a power cycle does.
+RTC_NOINIT_ATTR static airtime_budget_t airtimeBudget;
+// Airtime booked for the last uplink (all trials if confirmed), used for scheduling and refunds
+static uint32_t lastUplinkAirtime = 0;
+static uint32_t lastUplinkMs = 0;
+static uint8_t lastUplinkDr = LORAWAN_DEFAULT_DR;
+// Last uplink is confirmed and its number of retries is not known yet
+static bool lastUplinkOpen = false;
+// Join attempts are scheduled by loop(), not by the stack, so each one is checked against the budget
+static uint32_t joinScheduledMs = 0;
+static uint32_t joinDelayMs = 0;
+static uint32_t joinSentMs = 0;
+static bool joinPending = false;
+// Shown on the status display. networkJoined mirrors the MAC's join state, updated by loop()
+// so the display task does not call into the MAC from the other core.
+static std::atomic<bool> networkJoined{false};
+// Frames handed to the stack, not confirmed transmissions
+static std::atomic<uint32_t> uplinkAttempts{0};
+
+/* Millisecond clock for the airtime budget, based on the RTC so it keeps running across resets */
+static uint32_t budgetClockMs() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (uint32_t)(tv.tv_sec * 1000ULL + tv.tv_usec / 1000);
+}
+
+/* Data rate the next uplink will use, changes with ADR */
+static uint8_t currentDataRate() {
+  MibRequestConfirm_t mibReq;
+  mibReq.Type = MIB_CHANNELS_DATARATE;
+  if (LoRaMacMibGetRequestConfirm(&mibReq) != LORAMAC_STATUS_OK) {
+    return LORAWAN_DEFAULT_DR;
+  }
+  return mibReq.Param.ChannelsDatarate;
+}
+
+/* Asks the MAC whether the join accept was received */
+static bool isNetworkJoined() {
+  MibRequestConfirm_t mibReq;
+  mibReq.Type = MIB_NETWORK_JOINED;
+  return LoRaMacMibGetRequestConfirm(&mibReq) == LORAMAC_STATUS_OK && mibReq.Param.IsNetworkJoined;
+}
+
+/* Airtime the next uplink can use, worst case with all retries for confirmed frames */
+static uint32_t nextUplinkAirtime(uint8_t dr) {
+  if (isTxConfirmed) {
+    return eu868_confirmed_airtime_us(dr, PAYLOAD_SIZE, confirmedNbTrials);
+  }
+  return eu868_uplink_airtime_us(dr, PAYLOAD_SIZE);
+}
+
+/* Defers SEND by waitMs, the cycle timer brings us back */
+static void deferForAirtime(uint32_t waitMs) {
+  Serial.printf("No airtime available, deferring uplink by %lu s\n", (unsigned long)(waitMs / 1000 + 1));
+  txDutyCycleTime = waitMs + 1000;  // refill steps are coarse, add a small margin
+  LoRaWAN.cycle(txDutyCycleTime);
+  deviceState = DEVICE_STATE_SLEEP;
+}
+
+/*
+ * Returns to JOIN after delayMs. While not joined, the stack's cycle timer sends a
+ * join request on its own, bypassing the budget, so it is pushed out past our attempt.
+ */
+static void scheduleJoin(uint32_t delayMs) {
+  joinPending = false;
+  joinScheduledMs = budgetClockMs();
+  joinDelayMs = delayMs;
+  LoRaWAN.cycle(delayMs + JOIN_RETRY_MS);
+  deviceState = DEVICE_STATE_JOIN;
+}
+
 /* Liest die Batteriespannung und gibt sie als float (V) zurück */
 float readBatteryVoltage() {
   digitalWrite(ADC_CTRL, HIGH);
@@ -87,6 +190,66 @@ float readBatteryVoltage() {
   return (millivolts / 1000.0) * 4.9;
 }
 
+/* Reads all sensors, BME280 is in forced mode and measures on request */
+static void readSensors(sensor_sample_t &sample) {
+  sensors_event_t temp_event, pressure_event, humidity_event;
+  bme.takeForcedMeasurement();
+  bme_temp->getEvent(&temp_event);
+  bme_pressure->getEvent(&pressure_event);
+  bme_humidity->getEvent(&humidity_event);
+
+  sample.temperature = temp_event.temperature;
+  sample.humidity = humidity_event.relative_humidity;
+  sample.pressure = pressure_event.pressure;
+  sample.voltage = readBatteryVoltage();
+}
+
+/*
+ * Samples the sensors every SAMPLE_INTERVAL_MS, independent of radio timing.
+ * A task notification (DOWNLINK_CMD_SEND_NOW) takes an extra sample right away
+ * without shifting the periodic schedule.
+ */
+static void acquisitionTask(void *param) {
+  TickType_t nextWake = xTaskGetTickCount();
+  bool onDemand = false;
+  for (;;) {
+    sensor_sample_t sample;
+    readSensors(sample);
+    sampleTotals.add(sample);
+    if (onDemand) {
+      sendNowPending = true;
+    } else {
+      nextWake += pdMS_TO_TICKS(SAMPLE_INTERVAL_MS);
+    }
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = (int32_t)(nextWake - now) > 0 ? nextWake - now : 0;
+    onDemand = ulTaskNotifyTake(pdTRUE, wait) > 0;
+  }
+}
+
+/*
+ * Averages all samples taken since the last uplink, keeps the last average if none arrived.
+ * With latestOnly the newest sample is returned and the average window is left open,
+ * so those samples still go into the next regular uplink.
+ */
+static sensor_sample_t drainSamples(bool latestOnly) {
+  static sensor_sample_t last = {};
+  static SampleTotals drained = {};
+  SampleTotals now = sampleTotals.snapshot();
+  if (latestOnly) {
+    return now.count > 0 ? now.last : last;
+  }
+  uint32_t count = now.count - drained.count;
+  if (count > 0) {
+    last.temperature = (now.temperature - drained.temperature) / count;
+    last.humidity = (now.humidity - drained.humidity) / count;
+    last.pressure = (now.pressure - drained.pressure) / count;
+    last.voltage = (now.voltage - drained.voltage) / count;
+  }
+  drained = now;
+  return last;
+}
+
 /* Prepares the payload of the frame */
 static void prepareTxFrame(uint8_t port) {
   /*appData size is LORAWAN_APP_DATA_MAX_SIZE which is defined in "commissioning.h".
@@ -108,40 +271,209 @@ static void prepareTxFrame(uint8_t port) {
   // appData[2] = pressure_event.pressure;
   // appData[3] = 0x03;
 
-  sensors_event_t temp_event, pressure_event, humidity_event;
-  bme_temp->getEvent(&temp_event);
-  bme_pressure->getEvent(&pressure_event);
-  bme_humidity->getEvent(&humidity_event);
+  // Mittelwert der seit dem letzten Uplink erfassten Messwerte
+  sensor_sample_t sample = drainSamples(sendLatestOnly);
+  sendLatestOnly = false;
+  appDataSize = encode_payload(&sample, appData);
+}
 
-  // Spannung (Batteriespannung) auslesen
-  float voltage = readBatteryVoltage();
-
-  // Konvertiere Temperatur, Luftfeuchtigkeit und Druck in Integer
-  int16_t temperature = (int16_t)(temp_event.temperature * 100);           // Skalierung auf 2 Dezimalstellen
-  uint16_t humidity = (uint16_t)(humidity_event.relative_humidity * 100);  // Skalierung auf 2 Dezimalstellen
-  uint32_t pressure = (uint32_t)(pressure_event.pressure * 100);           // Skalierung auf 2 Dezimalstellen
-  uint16_t voltageInt = (uint16_t)(voltage * 100); // Skalierung auf 2 Dezimalstellen
-
-  // AppData-Größe festlegen (1 version byte + 9 data bytes)
-  appDataSize = 10;
-
-  // Payload zusammenstellen
-  appData[0] = 1; // Version byte
-  appData[1] = (temperature >> 8) & 0xFF;  // Temperatur, MSB
-  appData[2] = temperature & 0xFF;         // Temperatur, LSB
-  appData[3] = (humidity >> 8) & 0xFF;     // Luftfeuchtigkeit, MSB
-  appData[4] = humidity & 0xFF;            // Luftfeuchtigkeit, LSB
-  appData[5] = (pressure >> 16) & 0xFF;    // Druck, MSB
-  appData[6] = (pressure >> 8) & 0xFF;     // Druck, mittleres Byte
-  appData[7] = pressure & 0xFF;            // Druck, LSB
-  appData[8] = (voltageInt >> 8) & 0xFF;  // Spannung, MSB
-  appData[9] = voltageInt & 0xFF;         // Spannung, LSB
+//if true, next uplink will add MOTE_MAC_DEVICE_TIME_REQ
 
+/* Records the band off-time of retries 1..used-1 of the last uplink, at the latest time each can start */
+static void closeLastUplink(uint8_t used) {
+  for (uint8_t i = 1; i < used; i++) {
+    uint32_t start = lastUplinkMs + confirmed_trial_start_ms(lastUplinkDr, PAYLOAD_SIZE, i, CONFIRMED_RETRY_GAP_MAX_MS);
+    uint32_t airtime = eu868_uplink_airtime_us(confirmed_trial_dr(lastUplinkDr, i), PAYLOAD_SIZE);
+    airtime_budget_transmit(&airtimeBudget, EU868_BAND_ANY, airtime, start);
+  }
+  lastUplinkOpen = false;
 }
 
-//if true, next uplink will add MOTE_MAC_DEVICE_TIME_REQ
+/* Called by the LoRaWAN stack when a confirmed uplink was acknowledged */
+void downLinkAckHandle() {
+  if (!lastUplinkOpen) {
+    return;
+  }
+  // Count every trial that can have started by now with the shortest retry gap, so the
+  // estimate errs towards more trials and never refunds airtime that was used
+  uint32_t elapsed = budgetClockMs() - lastUplinkMs;
+  uint8_t used = 1;
+  while (used < confirmedNbTrials &&
+         confirmed_trial_start_ms(lastUplinkDr, PAYLOAD_SIZE, used, CONFIRMED_RETRY_GAP_MIN_MS) <= elapsed) {
+    used++;
+  }
+  // Retries were booked in advance, give back the ones that were not needed
+  if (used < confirmedNbTrials) {
+    uint32_t usedAirtime = eu868_confirmed_airtime_us(lastUplinkDr, PAYLOAD_SIZE, used);
+    airtime_budget_refund(&airtimeBudget, lastUplinkAirtime - usedAirtime, budgetClockMs());
+    lastUplinkAirtime = usedAirtime;
+  }
+  closeLastUplink(used);
+}
+
+/* Called by the LoRaWAN stack for every downlink, in Class C at any time */
+void downLinkDataHandle(McpsIndication_t *mcpsIndication) {
+  if (mcpsIndication->BufferSize == 0 || mcpsIndication->Port != appPort) {
+    return;
+  }
+  uint8_t *buf = mcpsIndication->Buffer;
+  switch (buf[0]) {
+    case DOWNLINK_CMD_SEND_NOW:
+      Serial.println("Downlink: measure and send now");
+      xTaskNotifyGive(acquisitionTaskHandle);
+      break;
+    case DOWNLINK_CMD_SET_DUTY:
+      if (mcpsIndication->BufferSize >= 3) {
+        uint16_t minutes = (buf[1] << 8) | buf[2];
+        if (minutes > 0) {
+          appTxDutyCycle = minutes * 60000UL;
+          Serial.printf("Downlink: duty cycle set to %u min\n", minutes);
+          // Reschedule right away instead of waiting for the old interval
+          if (deviceState == DEVICE_STATE_SLEEP) {
+            deviceState = DEVICE_STATE_CYCLE;
+          }
+        }
+      }
+      break;
+    default:
+      Serial.printf("Downlink: unknown command 0x%02X\n", buf[0]);
+      break;
+  }
+}
 
 
+// appKey received on core 0, applied from loop() so a running join never sees a half-written key
+static uint8_t stagedAppKey[16];
+static std::atomic<bool> appKeyStaged{false};
+
+/*
+ * Sends status byte and message in a single write, so debug output of the
+ * LoRaWAN stack on core 1 cannot end up between them.
+ */
+static void sendReply(uint8_t status, const char *message) {
+  uint8_t buf[64];
+  size_t len = snprintf((char *)buf + 1, sizeof(buf) - 1, "%s\r\n", message);
+  buf[0] = status;
+  Serial.write(buf, 1 + min(len, sizeof(buf) - 2));
+}
+
+/* Handles serial commands to set appKey and read devEui */
+static void handleSerialCommand() {
+  if (!Serial.available()) {
+    return;
+  }
+  uint8_t cmd = Serial.read();
+  switch (cmd) {
+    case 0xF0:  // Command to set appKey
+    {
+      // Wait for 16 bytes (appKey)
+      uint8_t keyBuf[16];
+      int received = 0;
+      unsigned long start = millis();
+      while (received < 16 && (millis() - start) < 2000) { // 2s timeout
+        if (Serial.available()) {
+          keyBuf[received++] = Serial.read();
+        } else {
+          vTaskDelay(1);  // let the idle task run while waiting
+        }
+      }
+      if (received == 16) {
+        // Store appKey in EEPROM (address 16-31)
+        for (int i = 0; i < 16; i++) {
+          EEPROM.write(16 + i, keyBuf[i]);
+        }
+        // Wait until loop() picked up a previously staged key
+        while (appKeyStaged.load(std::memory_order_acquire)) {
+          vTaskDelay(1);
+        }
+        memcpy(stagedAppKey, keyBuf, sizeof(stagedAppKey));
+        appKeyStaged.store(true, std::memory_order_release);
+        if (EEPROM.commit()) {
+          sendReply(0xAA, "appKey written to EEPROM successfully!"); // ACK
+        } else {
+          sendReply(0xEE, "Failed to commit appKey to EEPROM"); // ERROR
+        }
+      } else {
+        sendReply(0xEE, "Timeout or incomplete appKey received"); // ERROR
+      }
+      break;
+    }
+    case 0xEF:  // Command to read devEui
+    {
+      // ACK + devEui in one write
+      uint8_t reply[9];
+      reply[0] = 0xAA;
+      memcpy(&reply[1], devEui, 8);
+      Serial.write(reply, sizeof(reply));
+      break;
+    }
+    default:
+      // Unknown command, ignore or handle as needed
+      break;
+  }
+}
+
+/* Services serial/config commands without blocking the radio or the sensors */
+static void serialTask(void *param) {
+  for (;;) {
+    handleSerialCommand();
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+/*
+ * Shows the last readings, join state and battery on the OLED while the PRG
+ * button was pressed within STATUS_DISPLAY_ON_MS. Redrawing every poll is
+ * cheap: oled_flush() only sends the columns that changed.
+ */
+static void displayTask(void *param) {
+  pinMode(PRG_BUTTON, INPUT_PULLUP);
+  bool on = false;
+  unsigned long onSince = 0;
+  char line[OLED_LINE_CHARS + 1];
+
+  for (;;) {
+    SampleTotals totals = sampleTotals.snapshot();
+    const sensor_sample_t &latest = totals.last;
+
+    if (digitalRead(PRG_BUTTON) == LOW) {
+      oled_power(true);
+      on = true;
+      onSince = millis();
+    } else if (on && millis() - onSince > STATUS_DISPLAY_ON_MS) {
+      oled_power(false);
+      on = false;
+    }
+
+    if (on) {
+      snprintf(line, sizeof(line), "ClimateGuard Class %c", loraWanClass == CLASS_C ? 'C' : 'A');
+      oled_print(0, line);
+      snprintf(line, sizeof(line), "LoRa: %s", networkJoined ? "joined" : "joining");
+      oled_print(1, line);
+      snprintf(line, sizeof(line), "TX attempts: %lu", (unsigned long)uplinkAttempts.load());
+      oled_print(2, line);
+      if (uplinkAttempts > 0) {
+        snprintf(line, sizeof(line), "Last TX: %lus ago", (unsigned long)((budgetClockMs() - lastUplinkMs) / 1000));
+      } else {
+        snprintf(line, sizeof(line), "Last TX: -");
+      }
+      oled_print(3, line);
+      if (totals.count > 0) {
+        snprintf(line, sizeof(line), "Temp:  %6.2f C", latest.temperature);
+        oled_print(4, line);
+        snprintf(line, sizeof(line), "Hum:   %6.2f %%", latest.humidity);
+        oled_print(5, line);
+        snprintf(line, sizeof(line), "Press: %7.2f hPa", latest.pressure);
+        oled_print(6, line);
+        snprintf(line, sizeof(line), "Batt:  %6.2f V", latest.voltage);
+        oled_print(7, line);
+      }
+      oled_flush();
+    }
+    vTaskDelay(pdMS_TO_TICKS(DISPLAY_POLL_MS));
+  }
+}
+
 void setup() {
   pinMode(ADC_CTRL, OUTPUT);
 
@@ -176,6 +508,10 @@ void setup() {
 
   Mcu.begin(HELTEC_BOARD, SLOW_CLK_TPYE);
 
+  if (!airtime_budget_restore(&airtimeBudget, budgetClockMs())) {
+    airtime_budget_init(&airtimeBudget, budgetClockMs());
+  }
+
   Serial.println(F("Looking for a BME280 sensor"));
   while (!bme.begin(0x76))
   {
@@ -186,58 +522,27 @@ void setup() {
 
   Serial.println("Found BME280 sensor");
 
+  // Forced mode: the sensor sleeps between measurements triggered by the acquisition task,
+  // the library's default 16x oversampling is kept
+  bme.setSampling(Adafruit_BME280::MODE_FORCED);
+
   set_led(false);
+
+  // Sensors, serial and display on core 0, the radio keeps running in loop() on core 1
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", 4096, NULL, ACQUISITION_TASK_PRIO, &acquisitionTaskHandle, ACQUISITION_TASK_CORE);
+  xTaskCreatePinnedToCore(serialTask, "serial", 4096, NULL, SERIAL_TASK_PRIO, NULL, SERIAL_TASK_CORE);
+  xTaskCreatePinnedToCore(displayTask, "display", 4096, NULL, DISPLAY_TASK_PRIO, NULL, DISPLAY_TASK_CORE);
 }
 
 void loop() {
 
-  // Check for incoming serial commands to set appKey
-  if (Serial.available()) {
-    uint8_t cmd = Serial.read();
-    switch (cmd) {
-      case 0xF0:  // Command to set appKey
-      {
-        // Wait for 16 bytes (appKey)
-        uint8_t keyBuf[16];
-        int received = 0;
-        unsigned long start = millis();
-        while (received < 16 && (millis() - start) < 2000) { // 2s timeout
-          if (Serial.available()) {
-            keyBuf[received++] = Serial.read();
-          }
-        }
-        if (received == 16) {
-          // Store appKey in EEPROM (address 16-31)
-          for (int i = 0; i < 16; i++) {
-            EEPROM.write(16 + i, keyBuf[i]);
-            appKey[i] = keyBuf[i];
-          }
-          if (EEPROM.commit()) {
-            Serial.write(0xAA); // ACK
-            Serial.println("appKey written to EEPROM successfully!");
-          } else {
-            Serial.write(0xEE); // ERROR
-            Serial.println("Failed to commit appKey to EEPROM");
-          }
-        } else {
-          Serial.write(0xEE); // ERROR
-          Serial.println("Timeout or incomplete appKey received");
-        }
-        break;
-      }
-      case 0xEF:  // Command to read devEui
-      {
-        Serial.write(0xAA); // ACK
-        for (int i = 0; i < 8; i++) {
-          Serial.write(devEui[i]);
-        }
-        break;
-      }
-      default:
-        // Unknown command, ignore or handle as needed
-        break;
-    }
+  // New appKey from the serial task, applied between stack calls
+  if (appKeyStaged.load(std::memory_order_acquire)) {
+    memcpy(appKey, stagedAppKey, sizeof(stagedAppKey));
+    appKeyStaged.store(false, std::memory_order_release);
   }
+  // Status display: cleared again if the MAC drops the session
+  networkJoined = isNetworkJoined();
 
   switch (deviceState) {
     case DEVICE_STATE_INIT:
@@ -247,33 +552,105 @@ void loop() {
 #endif
         LoRaWAN.init(loraWanClass, loraWanRegion);
         //both set join DR and DR when ADR off
-        LoRaWAN.setDefaultDR(3);
+        LoRaWAN.setDefaultDR(LORAWAN_DEFAULT_DR);
         break;
       }
     case DEVICE_STATE_JOIN:
       {
+        uint32_t now = budgetClockMs();
+        if (now - joinScheduledMs < joinDelayMs) {
+          LoRaWAN.sleep(loraWanClass);
+          break;
+        }
+        // Join requests share the budget with uplinks, they only use the default channels in the 868.0 MHz band
+        uint32_t airtime = lora_airtime_us(12 - LORAWAN_DEFAULT_DR, 125000, LORAWAN_JOIN_REQUEST_SIZE, 1, 8, true, false);
+        uint32_t wait = airtime_budget_wait_band_ms(&airtimeBudget, EU868_BAND_868_0, airtime, now);
+        if (wait > 0) {
+          Serial.printf("Airtime budget exhausted, deferring join by %lu s\n", (unsigned long)(wait / 1000 + 1));
+          scheduleJoin(wait + 1000);
+          break;
+        }
         LoRaWAN.join();
+        if (deviceState == DEVICE_STATE_SLEEP) {
+          // Request sent (OTAA), keep the stack's timer quiet until we know the outcome
+          airtime_budget_charge_band(&airtimeBudget, EU868_BAND_868_0, airtime, now);
+          airtime_budget_transmit(&airtimeBudget, EU868_BAND_868_0, airtime, now);
+          LoRaWAN.cycle(JOIN_ACCEPT_TIMEOUT_MS + JOIN_RETRY_MS);
+          joinSentMs = now;
+          joinPending = true;
+        } else if (deviceState == DEVICE_STATE_CYCLE) {
+          // MAC refused the request, nothing was sent
+          scheduleJoin(JOIN_RETRY_MS);
+        }
         break;
       }
     case DEVICE_STATE_SEND:
       {
+        // A confirmed uplink without ACK keeps the MAC busy until its last retry is over
+        if (lastUplinkOpen) {
+          uint32_t elapsed = budgetClockMs() - lastUplinkMs;
+          uint32_t end = confirmed_trial_start_ms(lastUplinkDr, PAYLOAD_SIZE, confirmedNbTrials, CONFIRMED_RETRY_GAP_MAX_MS);
+          if (elapsed < end) {
+            deferForAirtime(end - elapsed);
+            break;
+          }
+          closeLastUplink(confirmedNbTrials);
+        }
+        // Without enough budget or a free band the frame waits, queued samples are merged into it
+        uint8_t dr = currentDataRate();
+        uint32_t airtime = nextUplinkAirtime(dr);
+        uint32_t wait = airtime_budget_wait_ms(&airtimeBudget, airtime, budgetClockMs());
+        if (wait > 0) {
+          deferForAirtime(wait);
+          break;
+        }
         prepareTxFrame(appPort);
         LoRaWAN.send();
-
-  	    bme.setSampling(Adafruit_BME280::MODE_SLEEP);
+        lastUplinkMs = budgetClockMs();
+        lastUplinkDr = dr;
+        uplinkAttempts++;
+        lastUplinkAirtime = airtime;
+        airtime_budget_charge(&airtimeBudget, airtime, lastUplinkMs);
+        // Retries of confirmed frames are recorded once their number is known
+        airtime_budget_transmit(&airtimeBudget, EU868_BAND_ANY, eu868_uplink_airtime_us(dr, PAYLOAD_SIZE), lastUplinkMs);
+        lastUplinkOpen = isTxConfirmed;
         deviceState = DEVICE_STATE_CYCLE;
         break;
       }
     case DEVICE_STATE_CYCLE:
       {
-        // Schedule next packet transmission
-        txDutyCycleTime = appTxDutyCycle + randr(-APP_TX_DUTYCYCLE_RND, APP_TX_DUTYCYCLE_RND);
+        // Not joined (the stack's timer tried to join while the MAC was busy), retry from JOIN
+        if (!isNetworkJoined()) {
+          scheduleJoin(JOIN_RETRY_MS);
+          break;
+        }
+        // Schedule next packet transmission, never faster than the airtime budget sustains.
+        // Retries are rare, so only the first transmission counts here; SEND still checks the worst case.
+        uint32_t sustainable = airtime_sustainable_interval_ms(eu868_uplink_airtime_us(currentDataRate(), PAYLOAD_SIZE));
+        uint32_t interval = max(appTxDutyCycle, sustainable);
+        txDutyCycleTime = interval + randr(-UPLINK_JITTER_MS, UPLINK_JITTER_MS);
         LoRaWAN.cycle(txDutyCycleTime);
         deviceState = DEVICE_STATE_SLEEP;
         break;
       }
     case DEVICE_STATE_SLEEP:
       {
+        // No join accept in RX1 or RX2, retry from JOIN instead of the stack's rejoin timer
+        if (joinPending && budgetClockMs() - joinSentMs >= JOIN_ACCEPT_TIMEOUT_MS) {
+          if (!isNetworkJoined()) {
+            Serial.println("Join failed, retrying");
+            scheduleJoin(JOIN_RETRY_MS);
+            break;
+          }
+          joinPending = false;
+        }
+        // On-demand sample is taken, fire the cycle timer right away instead of waiting for it.
+        // The stack only lets send() transmit after its timer moved us to SEND.
+        if (sendNowPending.exchange(false) && networkJoined) {
+          sendLatestOnly = true;
+          LoRaWAN.cycle(1);
+          break;
+        }
         LoRaWAN.sleep(loraWanClass);
         // // Set deep sleep timer for 10 minutes
         // esp_sleep_enable_timer_wakeup(appTxDutyCycle * 1000);
@@ -0,0 +1,133 @@
+#include "oled.h"
+#include "font5x7.h"
+
+#include <Wire.h>
+
+#define OLED_ADDRESS 0x3C
+#define OLED_I2C_FREQ 500000
+#define OLED_DATA_CHUNK 32 // bytes per I2C transaction, well below the Wire buffer size
+
+// Own I2C controller on the OLED pins, independent of the sensor bus
+static TwoWire &oledWire = Wire1;
+
+static uint8_t framebuffer[OLED_PAGES][OLED_WIDTH];
+// What the display RAM currently holds, compared against framebuffer on flush
+static uint8_t shadow[OLED_PAGES][OLED_WIDTH];
+static bool powered = false;
+
+static void send_commands(const uint8_t *cmds, uint8_t len)
+{
+    oledWire.beginTransmission(OLED_ADDRESS);
+    oledWire.write(0x00); // Co = 0, D/C = 0: command stream
+    oledWire.write(cmds, len);
+    oledWire.endTransmission();
+}
+
+static void send_data(const uint8_t *data, uint8_t len)
+{
+    oledWire.beginTransmission(OLED_ADDRESS);
+    oledWire.write(0x40); // Co = 0, D/C = 1: display data
+    oledWire.write(data, len);
+    oledWire.endTransmission();
+}
+
+void oled_power(bool on)
+{
+    if (on == powered)
+        return;
+    powered = on;
+
+    if (!on)
+    {
+        static const uint8_t off_seq[] = {0xAE}; // display off
+        send_commands(off_seq, sizeof(off_seq));
+        digitalWrite(Vext, HIGH);
+        return;
+    }
+
+    pinMode(Vext, OUTPUT);
+    digitalWrite(Vext, LOW);
+    delay(50);
+    pinMode(RST_OLED, OUTPUT);
+    digitalWrite(RST_OLED, LOW);
+    delay(1);
+    digitalWrite(RST_OLED, HIGH);
+    delay(1);
+    oledWire.begin(SDA_OLED, SCL_OLED, OLED_I2C_FREQ);
+
+    static const uint8_t init_seq[] = {
+        0xAE,       // display off
+        0xD5, 0x80, // clock divide
+        0xA8, 0x3F, // multiplex 64
+        0xD3, 0x00, // display offset
+        0x40,       // start line 0
+        0x8D, 0x14, // charge pump on
+        0x20, 0x00, // horizontal addressing mode
+        0xA1,       // segment remap
+        0xC8,       // COM scan direction remapped
+        0xDA, 0x12, // COM pins
+        0x81, 0xCF, // contrast
+        0xD9, 0xF1, // pre-charge
+        0xDB, 0x40, // VCOMH deselect
+        0xA4,       // display follows RAM
+        0xA6,       // normal, not inverted
+        0x2E,       // scrolling off
+        0xAF,       // display on
+    };
+    send_commands(init_seq, sizeof(init_seq));
+
+    // Display RAM content is unknown after power up, make the next flush send everything
+    for (uint8_t page = 0; page < OLED_PAGES; page++)
+        for (uint8_t col = 0; col < OLED_WIDTH; col++)
+            shadow[page][col] = ~framebuffer[page][col];
+}
+
+void oled_print(uint8_t line, const char *text)
+{
+    if (line >= OLED_PAGES)
+        return;
+    uint8_t *row = framebuffer[line];
+    uint8_t col = 0;
+    for (; *text && col + FONT_WIDTH + 1 <= OLED_WIDTH; text++)
+    {
+        char c = *text;
+        if (c < FONT_FIRST || c > FONT_LAST)
+            c = '?';
+        memcpy(&row[col], font5x7[c - FONT_FIRST], FONT_WIDTH);
+        col += FONT_WIDTH;
+        row[col++] = 0x00; // spacing
+    }
+    memset(&row[col], 0x00, OLED_WIDTH - col);
+}
+
+void oled_flush()
+{
+    if (!powered)
+        return;
+    for (uint8_t page = 0; page < OLED_PAGES; page++)
+    {
+        uint8_t *row = framebuffer[page];
+        uint8_t *old = shadow[page];
+
+        // Changed column range of this page, unchanged pages send nothing
+        int first = 0, last = OLED_WIDTH - 1;
+        while (first < OLED_WIDTH && row[first] == old[first])
+            first++;
+        if (first == OLED_WIDTH)
+            continue;
+        while (row[last] == old[last])
+            last--;
+
+        uint8_t window[] = {
+            0x21, (uint8_t)first, (uint8_t)last, // column range
+            0x22, page, page,                    // page range
+        };
+        send_commands(window, sizeof(window));
+        for (int col = first; col <= last; col += OLED_DATA_CHUNK)
+        {
+            int len = min(OLED_DATA_CHUNK, last - col + 1);
+            send_data(&row[col], len);
+        }
+        memcpy(&old[first], &row[first], last - first + 1);
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef __OLED_H__
+#define __OLED_H__
+
+#include <Arduino.h>
+
+// 128x64 SSD1306, 8 pages of 8 pixel rows, 21 characters per line with the 5x7 font
+#define OLED_WIDTH 128
+#define OLED_PAGES 8
+#define OLED_LINE_CHARS 21
+
+/* Powers the display via Vext and initializes it, or switches it off again */
+void oled_power(bool on);
+
+/* Writes text to one page (line 0..7) of the framebuffer, the rest of the line is cleared */
+void oled_print(uint8_t line, const char *text);
+
+/* Sends only the changed column range of each page over I2C */
+void oled_flush();
+
+#endif //__OLED_H__
@@ -0,0 +1,34 @@
+#include "payload.h"
+
+/* No Arduino dependencies here, the host-side simulator links this file too */
+
+uint8_t encode_payload(const sensor_sample_t *sample, uint8_t *buf)
+{
+    // Konvertiere Temperatur, Luftfeuchtigkeit und Druck in Integer
+    int16_t temperature = (int16_t)(sample->temperature * 100); // Skalierung auf 2 Dezimalstellen
+    uint16_t humidity = (uint16_t)(sample->humidity * 100);     // Skalierung auf 2 Dezimalstellen
+    uint32_t pressure = (uint32_t)(sample->pressure * 100);     // Skalierung auf 2 Dezimalstellen
+    uint16_t voltage = (uint16_t)(sample->voltage * 100);       // Skalierung auf 2 Dezimalstellen
+
+    // Payload zusammenstellen (1 version byte + 9 data bytes)
+    buf[0] = PAYLOAD_VERSION;
+    buf[1] = (temperature >> 8) & 0xFF; // Temperatur, MSB
+    buf[2] = temperature & 0xFF;        // Temperatur, LSB
+    buf[3] = (humidity >> 8) & 0xFF;    // Luftfeuchtigkeit, MSB
+    buf[4] = humidity & 0xFF;           // Luftfeuchtigkeit, LSB
+    buf[5] = (pressure >> 16) & 0xFF;   // Druck, MSB
+    buf[6] = (pressure >> 8) & 0xFF;    // Druck, mittleres Byte
+    buf[7] = pressure & 0xFF;           // Druck, LSB
+    buf[8] = (voltage >> 8) & 0xFF;     // Spannung, MSB
+    buf[9] = voltage & 0xFF;            // Spannung, LSB
+
+    return PAYLOAD_SIZE;
+}
+
+void decode_payload(const uint8_t *buf, sensor_sample_t *sample)
+{
+    sample->temperature = (int16_t)((buf[1] << 8) | buf[2]) / 100.0f; // signed, below 0 °C
+    sample->humidity = ((buf[3] << 8) | buf[4]) / 100.0f;
+    sample->pressure = ((buf[5] << 16) | (buf[6] << 8) | buf[7]) / 100.0f;
+    sample->voltage = ((buf[8] << 8) | buf[9]) / 100.0f;
+}
@@ -0,0 +1,33 @@
+#ifndef __PAYLOAD_H__
+#define __PAYLOAD_H__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* One reading of all sensors */
+    typedef struct
+    {
+        float temperature; // °C
+        float humidity;    // %
+        float pressure;    // hPa
+        float voltage;     // V
+    } sensor_sample_t;
+
+#define PAYLOAD_VERSION 1
+#define PAYLOAD_SIZE 10
+
+    /* Encodes a sample into buf (at least PAYLOAD_SIZE bytes), returns the payload length */
+    uint8_t encode_payload(const sensor_sample_t *sample, uint8_t *buf);
+
+    /* Decodes a payload the same way payloadFormatter.js does on TTN */
+    void decode_payload(const uint8_t *buf, sensor_sample_t *sample);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //__PAYLOAD_H__
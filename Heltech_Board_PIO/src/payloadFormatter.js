@@ -3,6 +3,7 @@ function decodeUplink(input) {
 
   var version = bytes[0]; // First byte is version
   var temperature = (bytes[1] << 8) | bytes[2]; // Combine MSB and LSB for temperature
+  if (temperature & 0x8000) temperature -= 0x10000; // Signed int16, below 0 °C
   var humidity = (bytes[3] << 8) | bytes[4];    // Combine MSB and LSB for humidity
   var pressure = (bytes[5] << 16) | (bytes[6] << 8) | bytes[7]; // Combine MSB, middle byte, and LSB for pressure
   var voltage = (bytes[8] << 8) | bytes[9]; // Combine MSB and LSB for voltage
@@ -17,3 +18,22 @@ function decodeUplink(input) {
     }
   };
 }
+
+// Downlink commands, see downLinkDataHandle() in main.cpp (port 2)
+// { "command": "send_now" } or { "command": "set_duty", "minutes": 30 }
+function encodeDownlink(input) {
+  var data = input.data;
+
+  if (data.command === "send_now") {
+    return { bytes: [0x01], fPort: 2 };
+  }
+  if (data.command === "set_duty") {
+    var minutes = data.minutes;
+    // The firmware reads a 16 bit interval and ignores 0
+    if (typeof minutes !== "number" || minutes % 1 !== 0 || minutes < 1 || minutes > 65535) {
+      return { errors: ["set_duty needs minutes between 1 and 65535"] };
+    }
+    return { bytes: [0x02, (minutes >> 8) & 0xFF, minutes & 0xFF], fPort: 2 };
+  }
+  return { errors: ["unknown command"] };
+}
@@ -0,0 +1,64 @@
+#ifndef __SAMPLE_ACCUMULATOR_H__
+#define __SAMPLE_ACCUMULATOR_H__
+
+#include <atomic>
+#include <stdint.h>
+
+#include "payload.h"
+
+/* Running totals since boot, consumers average over the difference of two snapshots */
+struct SampleTotals
+{
+    double temperature;
+    double humidity;
+    double pressure;
+    double voltage;
+    uint32_t count;
+    sensor_sample_t last;
+};
+
+/*
+ * Lock-free sample accumulator with one producer and any number of readers.
+ * Totals only grow, so readers never reset anything and no sample is dropped
+ * however long they wait. A sequence counter (seqlock) gives readers a
+ * consistent snapshot: odd while the producer is writing.
+ */
+class SampleAccumulator
+{
+public:
+    /* Producer only */
+    void add(const sensor_sample_t &sample)
+    {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        totals_.temperature += sample.temperature;
+        totals_.humidity += sample.humidity;
+        totals_.pressure += sample.pressure;
+        totals_.voltage += sample.voltage;
+        totals_.count++;
+        totals_.last = sample;
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    /* Any task, retries while the producer is writing */
+    SampleTotals snapshot() const
+    {
+        SampleTotals copy;
+        uint32_t before, after;
+        do
+        {
+            before = seq_.load(std::memory_order_acquire);
+            copy = totals_;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = seq_.load(std::memory_order_relaxed);
+        } while ((before & 1) || before != after);
+        return copy;
+    }
+
+private:
+    SampleTotals totals_ = {};
+    std::atomic<uint32_t> seq_{0};
+};
+
+#endif //__SAMPLE_ACCUMULATOR_H__
@@ -40,6 +40,14 @@ lorawan_version = os.getenv('LORAWAN_VERSION', '1.0.2')
 lorawan_phy_version = os.getenv('LORAWAN_PHY_VERSION', 'PHY_V1_0_2_REV_B')
 frequency_plan_id = os.getenv('FREQUENCY_PLAN_ID', 'EU_863_870')
 supports_join = os.getenv('SUPPORTS_JOIN', 'true').lower() == 'true'
+supports_class_c = os.getenv('SUPPORTS_CLASS_C', 'false').lower() == 'true'
+
+# PlatformIO environment to flash, follows SUPPORTS_CLASS_C unless set explicitly.
+# Class C firmware is built by the environments ending in "_class_c" (-D LORAWAN_CLASS_C).
+platformio_env = os.getenv('PLATFORMIO_ENV') or ('heltec_wifi_lora_32_V3_class_c' if supports_class_c else None)
+if platformio_env and platformio_env.endswith('_class_c') != supports_class_c:
+    raise ValueError(f"PLATFORMIO_ENV={platformio_env} does not match SUPPORTS_CLASS_C={supports_class_c}, "
+                     "the device would be registered with a different class than it is flashed with")
 baudrate = int(os.getenv('BAUD_RATE', '115200'))
 
 # Load climateguard API URL
@@ -298,7 +306,7 @@ def create_device_in_ttn(dev_eui):
             "supports_join": supports_join,
             "multicast": False,
             "supports_class_b": False,
-            "supports_class_c": False,
+            "supports_class_c": supports_class_c,
             "mac_settings": {
                 "rx2_data_rate_index": 0,
                 "rx2_frequency": "869525000"
@@ -529,8 +537,8 @@ if __name__ == "__main__":
         print("PLATFORMIO_PROJECT_PATH environment variable not set.")
         exit(1)
 
-    # Optional: Specify the environment name (if you have multiple environments in platformio.ini)
-    environment_name = None  # e.g., "esp32dev"
+    # Environment name from PLATFORMIO_ENV or SUPPORTS_CLASS_C, None flashes the default environment
+    environment_name = platformio_env
 
     # Flash the firmware
     flash_platformio_project(project_directory, environment_name)
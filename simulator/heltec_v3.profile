@@ -0,0 +1,14 @@
+# Current profile for Heltec WiFi LoRa 32 V3 running Heltech_Board_PIO
+# All values in mA; tx, rx and sample currents are drawn on top of base_ma
+
+# MCU awake, the firmware does not sleep between uplinks
+base_ma = 45
+# SX1262 transmitting at 14 dBm
+tx_ma = 105
+# SX1262 receiving (RX1/RX2 windows)
+rx_ma = 6
+# BME280 forced measurement (16x oversampling, about 113 ms) and ADC divider, per acquisition
+sample_ma = 2
+sample_ms = 125
+
+battery_mah = 3000
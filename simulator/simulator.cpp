@@ -0,0 +1,561 @@
+/*
+ * ClimateGuard trace-replay simulator
+ *
+ * Replays recorded sensor traces through the firmware's deviceState cycle
+ * (JOIN -> SEND -> CYCLE -> SLEEP) and reports airtime, energy and data
+ * fidelity for one or more reporting policies. Payload encoding and
+ * time-on-air are taken from the firmware sources (payload.c, airtime.c).
+ *
+ * Usage:
+ *   simulator TRACE [--duty MS[,MS..]] [--dr DR[,DR..]] [--confirmed 0|1[,..]]
+ *             [--trials N] [--loss P] [--profile FILE] [--seed N]
+ *             [--sample-interval MS]
+ */
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "airtime.h"
+#include "config.h"
+#include "payload.h"
+
+// RX2 data rate, flasher/create_device.py registers devices with rx2_data_rate_index 0 (SF12)
+#define RX2_DR 0
+// PHY length of an empty downlink (ACK): MHDR(1) + FHDR(7) + MIC(4)
+#define ACK_FRAME_SIZE 12
+// PHY length of a join accept without CFList
+#define JOIN_ACCEPT_SIZE 17
+// Symbols the radio listens for a preamble before an RX window times out
+#define RX_TIMEOUT_SYMBOLS 6
+
+struct TraceSample
+{
+    double t;  // seconds since trace start
+    sensor_sample_t v;
+};
+
+/* Currents in mA, tx/rx/sample are drawn on top of base_ma */
+struct Profile
+{
+    double base_ma = 45.0;      // MCU awake, the firmware does not sleep between uplinks
+    double tx_ma = 105.0;       // SX1262 at 14 dBm
+    double rx_ma = 6.0;         // SX1262 receiving
+    double sample_ma = 2.0;     // BME280 forced measurement + ADC divider
+    double sample_ms = 125.0;   // duration of one acquisition, BME280 at 16x oversampling
+    double battery_mah = 3000.0;
+};
+
+struct Policy
+{
+    uint32_t duty_ms;
+    uint8_t dr;
+    bool confirmed;
+};
+
+struct Result
+{
+    uint32_t uplinks = 0;
+    uint32_t deferred = 0;
+    uint32_t delivered = 0;
+    uint32_t attempts = 0;
+    double airtime_s = 0;
+    double charge_mas = 0;  // mA * s
+    double sq_err[4] = {0, 0, 0, 0};
+    double max_err[4] = {0, 0, 0, 0};
+    uint32_t err_count = 0;
+};
+
+static uint32_t rngState = 1;
+
+/* xorshift32, deterministic for a given --seed */
+static double randUnit()
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return (rngState & 0xFFFFFF) / (double)0x1000000;
+}
+
+static long randr(long min, long max)
+{
+    return min + (long)(randUnit() * (max - min + 1));
+}
+
+static bool findNumber(const char *line, const char *key, double *out)
+{
+    const char *p = strstr(line, key);
+    if (!p)
+        return false;
+    p = strchr(p + strlen(key), ':');
+    if (!p)
+        return false;
+    char *end;
+    *out = strtod(p + 1, &end);
+    return end != p + 1;
+}
+
+/*
+ * Loads JSON lines from Heltech_Board_Serial or sensor_log.csv from
+ * serial_reader.py. Other lines (banners, headers) are skipped.
+ */
+static bool loadTrace(const char *path, std::vector<TraceSample> &trace)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    char line[512];
+    double lastUptime = -1, offset = 0, firstWall = -1;
+    while (fgets(line, sizeof(line), f))
+    {
+        TraceSample s;
+        double uptime;
+        struct tm tm = {};
+        if (line[0] == '{')
+        {
+            if (!findNumber(line, "\"temperature\"", &uptime))
+                continue;
+            s.v.temperature = uptime;
+            if (!findNumber(line, "\"humidity\"", &uptime))
+                continue;
+            s.v.humidity = uptime;
+            if (!findNumber(line, "\"pressure\"", &uptime))
+                continue;
+            s.v.pressure = uptime;
+            if (!findNumber(line, "\"voltage\"", &uptime))
+                continue;
+            s.v.voltage = uptime;
+            if (!findNumber(line, "\"timestamp\"", &uptime))
+                continue;
+            // Device uptime restarts on reboot, continue from the last sample
+            uptime /= 1000.0;
+            if (uptime < lastUptime)
+                offset += lastUptime;
+            lastUptime = uptime;
+            s.t = offset + uptime;
+        }
+        else if (sscanf(line, "%d-%d-%d %d:%d:%d,%f,%f,%f,%f",
+                        &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+                        &s.v.temperature, &s.v.humidity, &s.v.pressure, &s.v.voltage) == 10)
+        {
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+            double wall = (double)timegm(&tm);
+            if (firstWall < 0)
+                firstWall = wall;
+            s.t = wall - firstWall;
+        }
+        else
+        {
+            continue;
+        }
+        trace.push_back(s);
+    }
+    fclose(f);
+
+    if (!trace.empty())
+    {
+        double t0 = trace.front().t;
+        for (TraceSample &s : trace)
+            s.t -= t0;
+    }
+    return true;
+}
+
+static bool loadProfile(const char *path, Profile &p)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        fprintf(stderr, "ERROR: cannot open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    char line[256], key[64];
+    double value;
+    while (fgets(line, sizeof(line), f))
+    {
+        if (line[0] == '#' || sscanf(line, " %63[^= ] = %lf", key, &value) != 2)
+            continue;
+        if (!strcmp(key, "base_ma")) p.base_ma = value;
+        else if (!strcmp(key, "tx_ma")) p.tx_ma = value;
+        else if (!strcmp(key, "rx_ma")) p.rx_ma = value;
+        else if (!strcmp(key, "sample_ma")) p.sample_ma = value;
+        else if (!strcmp(key, "sample_ms")) p.sample_ms = value;
+        else if (!strcmp(key, "battery_mah")) p.battery_mah = value;
+        else fprintf(stderr, "WARNING: unknown profile key '%s'\n", key);
+    }
+    fclose(f);
+    return true;
+}
+
+static double dataRateSymbolSeconds(uint8_t dr)
+{
+    uint8_t sf;
+    uint32_t bw;
+    eu868_dr_params(dr, &sf, &bw);
+    return (double)(1UL << sf) / bw;
+}
+
+static double downlinkSeconds(uint8_t dr, uint16_t phy_len)
+{
+    uint8_t sf;
+    uint32_t bw;
+    eu868_dr_params(dr, &sf, &bw);
+    // Downlinks carry no payload CRC
+    return lora_airtime_us(sf, bw, phy_len, 1, 8, false, false) / 1e6;
+}
+
+/* Charge for the RX1/RX2 windows after one transmission, rx1Len = 0 if nothing arrives */
+static double rxWindowsCharge(const Profile &p, uint8_t dr, uint16_t rx1Len)
+{
+    if (rx1Len > 0)
+        return p.rx_ma * downlinkSeconds(dr, rx1Len);
+    return p.rx_ma * RX_TIMEOUT_SYMBOLS * (dataRateSymbolSeconds(dr) + dataRateSymbolSeconds(RX2_DR));
+}
+
+/* Airtime booked before an uplink, worst case with all retries like the firmware */
+static uint32_t bookedAirtime(const Policy &pol, int trials)
+{
+    if (pol.confirmed)
+        return eu868_confirmed_airtime_us(pol.dr, PAYLOAD_SIZE, trials);
+    return eu868_uplink_airtime_us(pol.dr, PAYLOAD_SIZE);
+}
+
+/* Sim time in ms for the airtime budget, wraps like the firmware's 32 bit clock */
+static uint32_t budgetMs(double t)
+{
+    return (uint32_t)(uint64_t)(t * 1000.0);
+}
+
+/*
+ * Transmits one frame following the confirmedNbTrials data rate table, returns true if delivered.
+ * Retries that were booked but not needed go back into the budget.
+ */
+static bool transmit(const Profile &p, const Policy &pol, int trials, double loss,
+                     airtime_budget_t &budget, double t, Result &r)
+{
+    uint32_t booked = bookedAirtime(pol, trials);
+    airtime_budget_charge(&budget, booked, budgetMs(t));
+
+    int nb = pol.confirmed ? trials : 1;
+    uint32_t used = 0;
+    bool ok = false;
+    for (int i = 0; i < nb && !ok; i++)
+    {
+        uint8_t dr = confirmed_trial_dr(pol.dr, i);
+        uint32_t toa_us = eu868_uplink_airtime_us(dr, PAYLOAD_SIZE);
+        double toa = toa_us / 1e6;
+        ok = randUnit() >= loss;
+        // Retries follow the previous attempt after RX2 and the ACK timeout, like the firmware assumes
+        uint32_t start = budgetMs(t) + confirmed_trial_start_ms(pol.dr, PAYLOAD_SIZE, i, CONFIRMED_RETRY_GAP_MAX_MS);
+        airtime_budget_transmit(&budget, EU868_BAND_ANY, toa_us, start);
+        used += toa_us;
+        r.attempts++;
+        r.airtime_s += toa;
+        r.charge_mas += p.tx_ma * toa;
+        r.charge_mas += rxWindowsCharge(p, dr, (pol.confirmed && ok) ? ACK_FRAME_SIZE : 0);
+    }
+    if (used < booked)
+        airtime_budget_refund(&budget, booked - used, budgetMs(t));
+    return ok;
+}
+
+static void accumulateError(Result &r, const sensor_sample_t &held, const sensor_sample_t &raw)
+{
+    double err[4] = {held.temperature - raw.temperature, held.humidity - raw.humidity,
+                     held.pressure - raw.pressure, held.voltage - raw.voltage};
+    for (int i = 0; i < 4; i++)
+    {
+        r.sq_err[i] += err[i] * err[i];
+        if (fabs(err[i]) > r.max_err[i])
+            r.max_err[i] = fabs(err[i]);
+    }
+    r.err_count++;
+}
+
+/*
+ * Resamples the trace to the firmware's acquisition interval. Values between two
+ * trace samples are interpolated linearly, the trace is usually recorded at a
+ * different rate than the acquisition task samples.
+ */
+static std::vector<TraceSample> resample(const std::vector<TraceSample> &trace, uint32_t interval_ms)
+{
+    std::vector<TraceSample> out;
+    double step = interval_ms / 1000.0;
+    double duration = trace.back().t;
+    size_t i = 0;
+    for (uint32_t k = 0; k * step <= duration; k++)
+    {
+        double t = k * step;
+        while (i + 2 < trace.size() && trace[i + 1].t < t)
+            i++;
+        const sensor_sample_t &a = trace[i].v, &b = trace[i + 1].v;
+        double span = trace[i + 1].t - trace[i].t;
+        float f = span > 0 ? (float)((t - trace[i].t) / span) : 0.0f;
+        TraceSample s;
+        s.t = t;
+        s.v.temperature = a.temperature + f * (b.temperature - a.temperature);
+        s.v.humidity = a.humidity + f * (b.humidity - a.humidity);
+        s.v.pressure = a.pressure + f * (b.pressure - a.pressure);
+        s.v.voltage = a.voltage + f * (b.voltage - a.voltage);
+        out.push_back(s);
+    }
+    return out;
+}
+
+/*
+ * Replays the acquisitions through the deviceState cycle. Fidelity is measured
+ * against the raw trace, not against the resampled acquisitions.
+ */
+static Result simulate(const std::vector<TraceSample> &trace, const std::vector<TraceSample> &acquisitions,
+                       const Profile &p, const Policy &pol, int trials, double loss)
+{
+    Result r;
+    double duration = trace.back().t;
+
+    airtime_budget_t budget;
+    airtime_budget_init(&budget, 0);
+
+    // DEVICE_STATE_JOIN: one join request at LORAWAN_DEFAULT_DR on the 868.0 MHz band, accepted in RX1
+    uint32_t joinToaUs = lora_airtime_us(12 - LORAWAN_DEFAULT_DR, 125000, LORAWAN_JOIN_REQUEST_SIZE, 1, 8, true, false);
+    airtime_budget_charge_band(&budget, EU868_BAND_868_0, joinToaUs, 0);
+    airtime_budget_transmit(&budget, EU868_BAND_868_0, joinToaUs, 0);
+    double joinToa = joinToaUs / 1e6;
+    r.airtime_s += joinToa;
+    r.charge_mas += p.tx_ma * joinToa + rxWindowsCharge(p, LORAWAN_DEFAULT_DR, JOIN_ACCEPT_SIZE);
+
+    r.charge_mas += p.base_ma * duration;
+    r.charge_mas += p.sample_ma * p.sample_ms / 1000.0 * acquisitions.size();
+
+    // Like SampleAccumulator in the firmware: every acquisition since the previous
+    // uplink goes into the average, however long the uplink was deferred
+    sensor_sample_t last = {}, held = {};
+    double sum[4] = {0, 0, 0, 0};
+    uint32_t count = 0;
+    bool haveHeld = false;
+    double nextSend = 0;
+    size_t raw = 0;
+
+    // The application sees the last delivered value until the next one arrives
+    auto scoreUntil = [&](double t) {
+        for (; raw < trace.size() && trace[raw].t < t; raw++)
+            if (haveHeld)
+                accumulateError(r, held, trace[raw].v);
+    };
+
+    for (size_t i = 0; i <= acquisitions.size(); i++)
+    {
+        // The acquisition task samples from boot, so the first uplink already has data
+        double t = i < acquisitions.size() ? acquisitions[i].t : duration;
+        while (nextSend < t)
+        {
+            scoreUntil(nextSend);
+            // DEVICE_STATE_SEND, deferred while the airtime budget is exhausted
+            uint32_t wait = airtime_budget_wait_ms(&budget, bookedAirtime(pol, trials), budgetMs(nextSend));
+            if (wait > 0)
+            {
+                r.deferred++;
+                nextSend += (wait + 1000) / 1000.0;
+                continue;
+            }
+            if (count > 0)
+            {
+                last.temperature = sum[0] / count;
+                last.humidity = sum[1] / count;
+                last.pressure = sum[2] / count;
+                last.voltage = sum[3] / count;
+                sum[0] = sum[1] = sum[2] = sum[3] = 0;
+                count = 0;
+            }
+            uint8_t frame[PAYLOAD_SIZE];
+            encode_payload(&last, frame);
+            r.uplinks++;
+            if (transmit(p, pol, trials, loss, budget, nextSend, r))
+            {
+                r.delivered++;
+                decode_payload(frame, &held);
+                haveHeld = true;
+            }
+            // DEVICE_STATE_CYCLE, never faster than the airtime budget sustains without retries
+            uint32_t interval = airtime_sustainable_interval_ms(eu868_uplink_airtime_us(pol.dr, PAYLOAD_SIZE));
+            if (interval < pol.duty_ms)
+                interval = pol.duty_ms;
+            nextSend += (interval + randr(-UPLINK_JITTER_MS, UPLINK_JITTER_MS)) / 1000.0;
+        }
+        scoreUntil(t);
+        if (i < acquisitions.size())
+        {
+            const sensor_sample_t &v = acquisitions[i].v;
+            sum[0] += v.temperature;
+            sum[1] += v.humidity;
+            sum[2] += v.pressure;
+            sum[3] += v.voltage;
+            count++;
+        }
+    }
+    scoreUntil(duration + 1);
+    return r;
+}
+
+/* Parses one integer in [min, max], the whole argument must be a number */
+static bool parseLong(const char *arg, long min, long max, long *value)
+{
+    char *end;
+    errno = 0;
+    long v = strtol(arg, &end, 0);
+    if (end == arg || *end != '\0' || errno == ERANGE || v < min || v > max)
+        return false;
+    *value = v;
+    return true;
+}
+
+/* Parses a comma separated list of integers in [min, max] */
+static bool parseList(const char *arg, long min, long max, std::vector<long> &values)
+{
+    values.clear();
+    std::string s(arg);
+    size_t pos = 0;
+    while (pos <= s.size())
+    {
+        size_t comma = s.find(',', pos);
+        if (comma == std::string::npos)
+            comma = s.size();
+        long v;
+        if (!parseLong(s.substr(pos, comma - pos).c_str(), min, max, &v))
+            return false;
+        values.push_back(v);
+        pos = comma + 1;
+    }
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr,
+            "Usage: simulator TRACE [options]\n"
+            "  --duty MS[,MS..]        appTxDutyCycle in ms, > 0 (default: 600000)\n"
+            "  --dr DR[,DR..]          EU868 data rate 0..6 (default: LORAWAN_DEFAULT_DR = %d)\n"
+            "  --confirmed 0|1[,..]    isTxConfirmed (default: 1)\n"
+            "  --trials N              confirmedNbTrials 1..8 (default: 4)\n"
+            "  --loss P                per-attempt frame loss probability 0..1 (default: 0)\n"
+            "  --profile FILE          current profile, key = value lines\n"
+            "  --seed N                random seed (default: 1)\n"
+            "  --sample-interval MS    acquisition interval in ms (default: SAMPLE_INTERVAL_MS = %d)\n",
+            LORAWAN_DEFAULT_DR, SAMPLE_INTERVAL_MS);
+}
+
+static int invalidOption(const char *option, const char *value)
+{
+    fprintf(stderr, "ERROR: invalid value '%s' for %s\n", value, option);
+    usage();
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage();
+        return 1;
+    }
+
+    const char *tracePath = nullptr;
+    std::vector<long> duties = {600000}, drs = {LORAWAN_DEFAULT_DR}, confirmed = {1};
+    long trials = 4;
+    double loss = 0;
+    long sampleInterval = SAMPLE_INTERVAL_MS;
+    Profile profile;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char *a = argv[i];
+        bool hasValue = i + 1 < argc;
+        const char *v = hasValue ? argv[i + 1] : nullptr;
+        bool ok = true;
+        if (!strcmp(a, "--duty") && hasValue) ok = parseList(v, 1, INT32_MAX, duties);
+        else if (!strcmp(a, "--dr") && hasValue) ok = parseList(v, 0, 6, drs);
+        else if (!strcmp(a, "--confirmed") && hasValue) ok = parseList(v, 0, 1, confirmed);
+        else if (!strcmp(a, "--trials") && hasValue) ok = parseLong(v, 1, 8, &trials);
+        else if (!strcmp(a, "--sample-interval") && hasValue) ok = parseLong(v, 1, INT32_MAX, &sampleInterval);
+        else if (!strcmp(a, "--seed") && hasValue)
+        {
+            long seed;
+            ok = parseLong(v, LONG_MIN, LONG_MAX, &seed);
+            rngState = (uint32_t)seed | 1;
+        }
+        else if (!strcmp(a, "--loss") && hasValue)
+        {
+            char *end;
+            loss = strtod(v, &end);
+            ok = end != v && *end == '\0' && loss >= 0 && loss <= 1;
+        }
+        else if (!strcmp(a, "--profile") && hasValue)
+        {
+            if (!loadProfile(v, profile))
+                return 1;
+        }
+        else if (a[0] != '-' && !tracePath)
+        {
+            tracePath = a;
+            continue;
+        }
+        else
+        {
+            usage();
+            return 1;
+        }
+        if (!ok)
+            return invalidOption(a, v);
+        i++;
+    }
+
+    std::vector<TraceSample> trace;
+    if (!tracePath || !loadTrace(tracePath, trace))
+        return 1;
+    if (trace.size() < 2)
+    {
+        fprintf(stderr, "ERROR: trace %s contains less than two samples\n", tracePath);
+        return 1;
+    }
+
+    std::vector<TraceSample> acquisitions = resample(trace, (uint32_t)sampleInterval);
+
+    double days = trace.back().t / 86400.0;
+    fprintf(stderr, "Trace: %zu samples over %.2f days, %zu acquisitions every %ld ms\n",
+            trace.size(), days, acquisitions.size(), sampleInterval);
+
+    printf("duty_ms,dr,confirmed,uplinks,deferred,delivered,attempts,airtime_s,airtime_pct,"
+           "charge_mah,avg_ma,battery_days,temp_rmse,hum_rmse,pres_rmse,volt_rmse,temp_max_err\n");
+
+    uint32_t seed = rngState;
+    for (long duty : duties)
+        for (long dr : drs)
+            for (long conf : confirmed)
+            {
+                // Same random sequence for every policy so they stay comparable
+                rngState = seed;
+                Policy pol = {(uint32_t)duty, (uint8_t)dr, conf != 0};
+                Result r = simulate(trace, acquisitions, profile, pol, trials, loss);
+
+                double seconds = trace.back().t;
+                double mah = r.charge_mas / 3600.0;
+                double n = r.err_count ? r.err_count : 1;
+                printf("%ld,%ld,%d,%u,%u,%u,%u,%.3f,%.4f,%.2f,%.3f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                       duty, dr, pol.confirmed, r.uplinks, r.deferred, r.delivered, r.attempts,
+                       r.airtime_s, 100.0 * r.airtime_s / seconds,
+                       mah, r.charge_mas / seconds, profile.battery_mah / (mah / days),
+                       sqrt(r.sq_err[0] / n), sqrt(r.sq_err[1] / n),
+                       sqrt(r.sq_err[2] / n), sqrt(r.sq_err[3] / n), r.max_err[0]);
+            }
+    return 0;
+}